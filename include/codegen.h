@@ -6,11 +6,49 @@
 
 #define ROM_SIZE_MAX (0x10000/2)
 
+typedef enum {
+    NOP,    HALT,
+    PUSH,   DUP,
+    OVER,   POP,
+    NIP,    SWAP,
+    ROT,    LOAD,
+    STORE,  LOADb,
+    STOREb, ADD,
+    SUB,    ADDc,
+    SUBc,   SHL,
+    SHR,    bNAND,
+    NAND,   EQUAL,
+    MORE,   LESS,
+    JUMP,   JIF0, 
+    JIFN0,
+    CALL,   RET
+} Instruction;
+
 typedef struct {
     uint8_t data[ROM_SIZE_MAX]; // 32 KiB of ROM
     uint16_t size; 
 } Rom;
 
-void GenerateCode(const TokenList* src, Rom* dest);
+typedef struct {
+    char name[LEXEME_MAX_LENGTH+1];
+    uint16_t start; // Address of the first instruction
+    uint16_t end; // Address after the RET
+    unsigned int line;
+} Symbol;
+
+// Maps the start of each run of instructions to the source line they came from
+typedef struct {
+    uint16_t address;
+    unsigned int line;
+} LineInfo;
+
+typedef struct {
+    Symbol words[ROM_SIZE_MAX]; // Every word takes at least 1 byte so they can't exceed the rom size
+    uint16_t word_count;
+    LineInfo lines[ROM_SIZE_MAX];
+    uint16_t line_count;
+} SymbolMap;
+
+void GenerateCode(const TokenList* src, Rom* dest, SymbolMap* symbols);
 
 #endif 
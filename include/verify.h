@@ -0,0 +1,18 @@
+#ifndef VERIFY_HEADER
+#define VERIFY_HEADER
+
+#include <stdbool.h>
+#include "codegen.h"
+
+// Checks that a rom is well-formed so a VM can run it without bounds checking every instruction.
+// Every opcode must be known, every JUMP/JIF0/JIFN0/CALL must land on an instruction boundary inside
+// the program, and the stack depth must be the same on every path into an instruction.
+// Starting from address 0 with empty stacks, nothing may pop an empty data stack, RET may not run with an
+// empty return stack and no word that can neither return nor halt may be called.
+// How deep the stacks grow can depend on the data (recursion like fib), so overflow still has to be checked.
+// This only covers the code as loaded. STORE/STOREb can rewrite the program region, so a VM skipping the checks
+// has to trap stores into [0, rom->size) or fall back to its checked loop once one happens.
+// Errors are printed and false is returned if the rom fails any check.
+bool VerifyRom(const Rom* rom);
+
+#endif 
@@ -7,24 +7,6 @@
 
 #define ARR_LEN(arr) (sizeof(arr)/sizeof(arr[0]))
 
-typedef enum {
-    NOP,    HALT,
-    PUSH,   DUP,
-    OVER,   POP,
-    NIP,    SWAP,
-    ROT,    LOAD,
-    STORE,  LOADb,
-    STOREb, ADD,
-    SUB,    ADDc,
-    SUBc,   SHL,
-    SHR,    bNAND,
-    NAND,   EQUAL,
-    MORE,   LESS,
-    JUMP,   JIF0, 
-    JIFN0,
-    CALL,   RET
-} Instruction;
-
 static inline void EmitByte(Rom* dest, uint8_t byte) {
     if (dest->size >= ROM_SIZE_MAX) {
         printf("[ERROR]: Program size exceeds rom size limit\n");
@@ -182,7 +164,20 @@ static inline struct IfInfo PeekIfStack(IfStack* stack) {
     return stack->data[stack->ptr-1];
 }
 
-void GenerateCode(const TokenList* src, Rom* dest) {
+static inline void RecordLine(uint16_t address, unsigned int line, SymbolMap* symbols) {
+    if (symbols->line_count > 0) {
+        LineInfo* last = &symbols->lines[symbols->line_count-1];
+        if (last->line == line) return;
+        if (last->address == address) { // The previous line didn't emit any code
+            last->line = line;
+            return;
+        }
+    }
+    if (symbols->line_count >= ROM_SIZE_MAX) return;
+    symbols->lines[symbols->line_count++] = (LineInfo){.address = address, .line = line};
+}
+
+void GenerateCode(const TokenList* src, Rom* dest, SymbolMap* symbols) {
     // Primitives are words that are defined in the language itself
     // They can be overwritten by code, however it will cause a warning. TODO: Add a flag to hide warnings
     char* instruction_primitives[] = {
@@ -212,6 +207,7 @@ void GenerateCode(const TokenList* src, Rom* dest) {
     bool in_word_definition = false;
     for (int i=0; i<src->length; i++) {
         Token token = src->data[i];
+        RecordLine(dest->size, token.line, symbols);
 
         switch (token.type) {
             case FUNC_START:
@@ -236,6 +232,12 @@ void GenerateCode(const TokenList* src, Rom* dest) {
                     } else { 
                         WordListInsert(token.lexeme, dest->size, &words);
                     }
+                    if (symbols->word_count < ROM_SIZE_MAX) {
+                        Symbol* symbol = &symbols->words[symbols->word_count++];
+                        strcpy(symbol->name, token.lexeme);
+                        symbol->start = dest->size;
+                        symbol->line = token.line;
+                    }
                     if (strcmp(token.lexeme, "main") == 0) {
                         uint16_t address = dest->size;
                         dest->size = 1;
@@ -254,6 +256,7 @@ void GenerateCode(const TokenList* src, Rom* dest) {
                 } else {
                     EmitByte(dest, RET);
                     in_word_definition = false; 
+                    symbols->words[symbols->word_count-1].end = dest->size;
 
                     for (int i=loops.ptr; i>0; i--) {
                         printf("[ERROR]: Loop at line %d is unterminated\n", PopLoopStack(&loops).line);
@@ -332,8 +335,8 @@ void GenerateCode(const TokenList* src, Rom* dest) {
             }
 
             case IF_START: 
-                PushIfStack(dest->size, token.line, &if_statements);
-                EmitByte(dest, JIFN0);
+                EmitByte(dest, JIF0); // Skip to 'then' when the condition is false
+                PushIfStack(dest->size, token.line, &if_statements); // Address of the operand that 'then' patches
                 dest->size += 2; // Reserve space for jump address
                 break;
 
@@ -381,6 +384,12 @@ void GenerateCode(const TokenList* src, Rom* dest) {
         
         }
     }
+
+    // A definition without ';' runs to the end of the program
+    if (in_word_definition) {
+        symbols->words[symbols->word_count-1].end = dest->size;
+    }
+
     if (has_errored) exit(-1);
 }
 
@@ -5,6 +5,22 @@
 #include <ctype.h>
 #include <stdbool.h>
 
+// Parallel scanning is opt-in because it needs C11 <threads.h>, which macOS doesn't have and which older
+// glibc only provides through libpthread. Build with -DPARALLEL_SCAN -pthread to turn it on
+#if defined(PARALLEL_SCAN) && !defined(__STDC_NO_THREADS__)
+#define USE_SCAN_THREADS
+#include <threads.h>
+#endif
+
+// Sources smaller than this are scanned on a single thread since starting threads costs more than it saves
+#define SCAN_PARALLEL_MIN_LENGTH (1 << 20)
+
+// Every chunk is lexed twice (once for each comment state), so the parallel scan does about twice the work
+// of the serial one. It only pays off with several cores, so set this to around the core count of the machine
+#ifndef SCAN_THREAD_COUNT
+#define SCAN_THREAD_COUNT 8
+#endif
+
 static TokenList TokenListCreate(unsigned int start_capacity) {
     TokenList new_list = {
         .capacity = start_capacity,
@@ -33,23 +49,22 @@ static void AddToken(char lexeme[LEXEME_MAX_LENGTH+1], TokenType type, unsigned
     list->length++;
 }
 
-static void FetchLexemes(char* program, TokenList* tokens) { 
-    size_t program_length = strlen(program);
-
-    unsigned int line = 1;
-    unsigned int next_line = 1; // Because defer doesn't exist in C
-    size_t start = 0;
+// Lexes program[begin..end). 'begin' has to be the start of the program or come right after whitespace
+// Lines are counted from 'first_line' and 'in_comment' holds the comment state going in and coming out
+static bool LexRange(const char* program, size_t begin, size_t end, unsigned int first_line, bool* in_comment, bool report_errors, TokenList* tokens) {
+    unsigned int line = first_line;
+    unsigned int next_line = first_line; // Because defer doesn't exist in C
+    size_t start = begin;
 
-    bool in_comment = false;
     bool has_errored = false;
 
-    for (size_t current=0; current<program_length; current++) {
+    for (size_t current=begin; current<end; current++) {
         switch (program[current]) {
             case '(':
-                in_comment = true;
+                *in_comment = true;
                 continue;
             case ')':
-                in_comment = false;
+                *in_comment = false;
                 start = current+1;
                 continue;
 
@@ -60,7 +75,7 @@ static void FetchLexemes(char* program, TokenList* tokens) {
                 // Create token
 
                 // Unless we're in a comment
-                if (in_comment) {
+                if (*in_comment) {
                     start = current+1;
                     line = next_line;
                     continue;
@@ -80,7 +95,9 @@ static void FetchLexemes(char* program, TokenList* tokens) {
                 }
                 lexeme[token_length] = '\0';
                 if (token_length > LEXEME_MAX_LENGTH+1) { 
-                    printf("[ERROR]: Word: '%s' at line %d exceeds max word length of 32 characters\n", lexeme, line);
+                    if (report_errors) {
+                        printf("[ERROR]: Word: '%s' at line %d exceeds max word length of 32 characters\n", lexeme, line);
+                    }
                     has_errored = true;
                     start = current+1;
                     line = next_line;
@@ -95,7 +112,14 @@ static void FetchLexemes(char* program, TokenList* tokens) {
         }
     }
 
-    if (has_errored) exit(-1); 
+    return has_errored;
+}
+
+static void FetchLexemes(char* program, TokenList* tokens) { 
+    size_t program_length = strlen(program);
+    bool in_comment = false;
+
+    if (LexRange(program, 0, program_length, 1, &in_comment, true, tokens)) exit(-1); 
 }
 
 static bool StrIsDecimal(char* str) {
@@ -132,107 +156,269 @@ static bool StrIsOct(char* str) {
     return true;
 }
 
+// Returns false if the token looks like a hex, binary or octal number but isn't valid. Its type is left unassigned
+static bool AssignType(Token* token) {
+    if (strcmp(token->lexeme, ":") == 0) {
+        token->type = FUNC_START;
+        return true;
+    }
+
+    if (strcmp(token->lexeme, ";") == 0) {
+        token->type = FUNC_END;
+        return true;
+    }
+
+    // Is it a base-10 number??
+    if (StrIsDecimal(token->lexeme)) {
+        token->type = NUM_DEC;
+        return true;
+    }
+
+    // Other number formats (hex, binary, octal)
+    if (token->lexeme[0] == '0') {
+        switch (token->lexeme[1]) {
+            // hex
+            case 'x': 
+                if (!StrIsHex(token->lexeme)) return false;
+                token->type = NUM_HEX;
+                return true;
+
+            // binary
+            case 'b': 
+                if (!StrIsBin(token->lexeme)) return false;
+                token->type = NUM_BIN;
+                return true;
+
+            // octal
+            case 'o': 
+                if (!StrIsOct(token->lexeme)) return false;
+                token->type = NUM_OCT;
+                return true;
+        
+        }
+
+    }
+
+    // If statements and loops
+    if (strcmp(token->lexeme, "if") == 0) {
+        token->type = IF_START;
+        return true;
+    }
+    if (strcmp(token->lexeme, "else") == 0) {
+        token->type = IF_START;
+        return true;
+    }
+    if (strcmp(token->lexeme, "then") == 0) {
+        token->type = IF_THEN;
+        return true;
+    }
+
+    if (strcmp(token->lexeme, "do") == 0) {
+        token->type = LOOP_START;
+        return true;
+    }
+    if (strcmp(token->lexeme, "while") == 0) {
+        token->type = LOOP_WHILE;
+        return true;
+    }
+    if (strcmp(token->lexeme, "until") == 0) {
+        token->type = LOOP_UNTIL;
+        return true;
+    }
+    if (strcmp(token->lexeme, "again") == 0) {
+        token->type = LOOP_AGAIN;
+        return true;
+    }
+    if (strcmp(token->lexeme, "leave") == 0) {
+        token->type = LOOP_LEAVE;
+        return true;
+    }
+
+    // Default
+    token->type = WORD;
+    return true;
+}
+
+static void ReportInvalidNumber(Token* token) {
+    switch (token->lexeme[1]) {
+        case 'x':
+            printf("[ERROR]: '%s' at line %d is not a valid hexadecimal number\n", token->lexeme, token->line);
+            break;
+        case 'b':
+            printf("[ERROR]: '%s' at line %d is not a valid binary number\n", token->lexeme, token->line);
+            break;
+        case 'o':
+            printf("[ERROR]: '%s' at line %d is not a valid octal number\n", token->lexeme, token->line);
+            break;
+    }
+}
+
 static void AssignTypes(TokenList* tokens) {
     bool has_errored = false;
 
     for (int i=0; i<tokens->length; i++) {
-        Token* token = &tokens->data[i];
-
-        if (strcmp(token->lexeme, ":") == 0) {
-            token->type = FUNC_START;
-            continue;
+        if (!AssignType(&tokens->data[i])) {
+            ReportInvalidNumber(&tokens->data[i]);
+            has_errored = true;
         }
+    }
+    if (has_errored) exit(-1);
+}
 
-        if (strcmp(token->lexeme, ";") == 0) {
-            token->type = FUNC_END;
-            continue;
-        }
+#ifdef USE_SCAN_THREADS
 
-        // Is it a base-10 number??
-        if (StrIsDecimal(token->lexeme)) {
-            token->type = NUM_DEC;
-            continue;
-        }
+typedef struct {
+    const char* program;
+    size_t begin;
+    size_t end;
+    unsigned int newlines;
 
-        // Other number formats (hex, binary, octal)
-        if (token->lexeme[0] == '0') {
-            switch (token->lexeme[1]) {
-                // hex
-                case 'x': 
-                    if (StrIsHex(token->lexeme)) {
-                        token->type = NUM_HEX;
-                    } else {
-                        printf("[ERROR]: '%s' at line %d is not a valid hexadecimal number\n", token->lexeme, token->line);
-                        has_errored = true;
-                    }
-                    continue;
+    // We don't know if the chunk starts inside a comment until the previous chunk is done
+    // So it gets lexed both ways and the right one is picked afterwards. [0] starts outside a comment, [1] inside
+    TokenList tokens[2];
+    bool ends_in_comment[2];
+    bool has_errored[2];
+} LexChunk;
 
-                // binary
-                case 'b': 
-                    if (StrIsBin(token->lexeme)) {
-                        token->type = NUM_BIN;
-                    } else {
-                        printf("[ERROR]: '%s' at line %d is not a valid binary number\n", token->lexeme, token->line);
-                        has_errored = true;
-                    }
-                    continue;
+static int LexChunkThread(void* arg) {
+    LexChunk* chunk = arg;
 
-                // octal
-                case 'o': 
-                    if (StrIsOct(token->lexeme)) {
-                        token->type = NUM_OCT;
-                    } else {
-                        printf("[ERROR]: '%s' at line %d is not a valid octal number\n", token->lexeme, token->line);
-                        has_errored = true;
-                    }
-                    continue;
-            
-            }
+    chunk->newlines = 0;
+    for (size_t i=chunk->begin; i<chunk->end; i++) {
+        if (chunk->program[i] == '\n') chunk->newlines++;
+    }
 
-        }
+    for (int i=0; i<2; i++) {
+        bool in_comment = i;
+        chunk->tokens[i] = TokenListCreate(16);
+        // Lines are relative to the start of the chunk and get fixed up once every chunk is done
+        chunk->has_errored[i] = LexRange(chunk->program, chunk->begin, chunk->end, 0, &in_comment, false, &chunk->tokens[i]);
+        chunk->ends_in_comment[i] = in_comment;
+    }
 
-        // If statements and loops
-        if (strcmp(token->lexeme, "if") == 0) {
-            token->type = IF_START;
-            continue;
-        }
-        if (strcmp(token->lexeme, "else") == 0) {
-            token->type = IF_START;
-            continue;
-        }
-        if (strcmp(token->lexeme, "then") == 0) {
-            token->type = IF_THEN;
-            continue;
-        }
+    return 0;
+}
 
-        if (strcmp(token->lexeme, "do") == 0) {
-            token->type = LOOP_START;
-            continue;
-        }
-        if (strcmp(token->lexeme, "while") == 0) {
-            token->type = LOOP_WHILE;
-            continue;
-        }
-        if (strcmp(token->lexeme, "until") == 0) {
-            token->type = LOOP_UNTIL;
-            continue;
-        }
-        if (strcmp(token->lexeme, "again") == 0) {
-            token->type = LOOP_AGAIN;
-            continue;
-        }
-        if (strcmp(token->lexeme, "leave") == 0) {
-            token->type = LOOP_LEAVE;
-            continue;
+typedef struct {
+    Token* data;
+    size_t length;
+    bool has_errored;
+} TypeChunk;
+
+static int AssignTypesThread(void* arg) {
+    TypeChunk* chunk = arg;
+
+    chunk->has_errored = false;
+    for (size_t i=0; i<chunk->length; i++) {
+        if (!AssignType(&chunk->data[i])) chunk->has_errored = true;
+    }
+
+    return 0;
+}
+
+// Runs 'func' on every item, falling back to the calling thread if a thread can't be started
+static void RunThreads(thrd_start_t func, void* items, size_t item_size, int count) {
+    thrd_t threads[SCAN_THREAD_COUNT];
+    bool started[SCAN_THREAD_COUNT];
+
+    for (int i=0; i<count; i++) {
+        void* item = (char*)items + i*item_size;
+        started[i] = thrd_create(&threads[i], func, item) == thrd_success;
+        if (!started[i]) func(item);
+    }
+    for (int i=0; i<count; i++) {
+        if (started[i]) thrd_join(threads[i], NULL);
+    }
+}
+
+static bool IsWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Gives the same result as 'FetchLexemes' followed by 'AssignTypes', but splits the work between threads
+static TokenList ScanParallel(char* program, size_t program_length) {
+    LexChunk chunks[SCAN_THREAD_COUNT];
+
+    // Chunks have to start right after whitespace so no token is split between two chunks
+    size_t begin = 0;
+    for (int i=0; i<SCAN_THREAD_COUNT; i++) {
+        size_t end = program_length * (i+1) / SCAN_THREAD_COUNT;
+        if (end < begin) end = begin;
+        while (end < program_length && !IsWhitespace(program[end-1])) end++;
+
+        chunks[i] = (LexChunk){.program = program, .begin = begin, .end = end};
+        begin = end;
+    }
+
+    RunThreads(LexChunkThread, chunks, sizeof(LexChunk), SCAN_THREAD_COUNT);
+
+    // Follow the comment state from chunk to chunk to pick the right results
+    bool in_comment = false;
+    bool has_errored = false;
+    size_t total_length = 0;
+    int picked[SCAN_THREAD_COUNT];
+    for (int i=0; i<SCAN_THREAD_COUNT; i++) {
+        picked[i] = in_comment;
+        has_errored |= chunks[i].has_errored[picked[i]];
+        total_length += chunks[i].tokens[picked[i]].length;
+        in_comment = chunks[i].ends_in_comment[picked[i]];
+    }
+
+    TokenList tokens = TokenListCreate(total_length > 16 ? total_length : 16);
+    unsigned int first_line = 1;
+    for (int i=0; i<SCAN_THREAD_COUNT; i++) {
+        TokenList* chunk_tokens = &chunks[i].tokens[picked[i]];
+        for (size_t j=0; j<chunk_tokens->length; j++) {
+            chunk_tokens->data[j].line += first_line;
         }
+        memcpy(&tokens.data[tokens.length], chunk_tokens->data, chunk_tokens->length*sizeof(Token));
+        tokens.length += chunk_tokens->length;
+        first_line += chunks[i].newlines;
 
-        // Default
-        token->type = WORD;
+        free(chunks[i].tokens[0].data);
+        free(chunks[i].tokens[1].data);
     }
-    if (has_errored) exit(-1);
+
+    // Errors are rare, so just let the serial lexer print them in the right order
+    if (has_errored) {
+        free(tokens.data);
+        tokens = TokenListCreate(16);
+        FetchLexemes(program, &tokens);
+    }
+
+    TypeChunk type_chunks[SCAN_THREAD_COUNT];
+    size_t type_begin = 0;
+    for (int i=0; i<SCAN_THREAD_COUNT; i++) {
+        size_t type_end = tokens.length * (i+1) / SCAN_THREAD_COUNT;
+        type_chunks[i] = (TypeChunk){.data = &tokens.data[type_begin], .length = type_end - type_begin};
+        type_begin = type_end;
+    }
+
+    RunThreads(AssignTypesThread, type_chunks, sizeof(TypeChunk), SCAN_THREAD_COUNT);
+
+    has_errored = false;
+    for (int i=0; i<SCAN_THREAD_COUNT; i++) {
+        has_errored |= type_chunks[i].has_errored;
+    }
+    if (has_errored) {
+        // Invalid numbers are the only tokens left without a type
+        for (size_t i=0; i<tokens.length; i++) {
+            if (tokens.data[i].type == (TokenType)-1) ReportInvalidNumber(&tokens.data[i]);
+        }
+        exit(-1);
+    }
+
+    return tokens;
 }
 
+#endif
+
 TokenList Scan(char* program) {
+#ifdef USE_SCAN_THREADS
+    size_t program_length = strlen(program);
+    if (program_length >= SCAN_PARALLEL_MIN_LENGTH) return ScanParallel(program, program_length);
+#endif
+
     TokenList tokens = TokenListCreate(16);
     FetchLexemes(program, &tokens);
     AssignTypes(&tokens);
@@ -4,6 +4,7 @@
 #include "../include/compiler.h"
 #include "../include/lexer.h"
 #include "../include/codegen.h"
+#include "../include/verify.h"
 
 static char* ReadFileData(const char* path) {
     FILE* fp = fopen(path, "r");
@@ -70,21 +71,71 @@ static void WriteHexDumpFile(const char* path, Rom* code) {
     fclose(fp);
 }
 
+static void ReadRomFile(const char* path, Rom* code) {
+    FILE* fp = fopen(path, "rb");
+
+    ASSERT_FORMAT(fp != NULL, "Failed to open file: '%s'", path);
+    ASSERT_FORMAT(fread(code, sizeof(Rom), 1, fp) == 1, "File: '%s' is not a valid rom", path);
+
+    fclose(fp);
+}
+
+// One 'word <start> <end> <line> <name>' entry per word definition followed by
+// one 'line <address> <line>' entry for each address where the source line changes
+static void WriteSymbolFile(const char* path, SymbolMap* symbols) {
+    char output_path[strlen(path)+5]; // + '.sym\0'
+    strcpy(output_path, path);
+    RemoveFileExtension(output_path);
+    strcat(output_path, ".sym\0");
+
+    FILE* fp = fopen(output_path, "w");
+
+    ASSERT_FORMAT(fp != NULL, "Failed to create file: '%s'", path);
+
+    for (int i=0; i<symbols->word_count; i++) {
+        Symbol* word = &symbols->words[i];
+        fprintf(fp, "word %04x %04x %u %s\n", word->start, word->end, word->line, word->name);
+    }
+    for (int i=0; i<symbols->line_count; i++) {
+        fprintf(fp, "line %04x %u\n", symbols->lines[i].address, symbols->lines[i].line);
+    }
+
+    fclose(fp);
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         printf("Not enough arguments\n");
         return -1;
     }
 
+    if (strcmp(argv[1], "--verify") == 0) {
+        if (argc < 3) {
+            printf("Not enough arguments\n");
+            return -1;
+        }
+
+        Rom rom = { 0 };
+        ReadRomFile(argv[2], &rom);
+        if (!VerifyRom(&rom)) return -1;
+
+        printf("'%s' is a valid rom\n", argv[2]);
+        return 0;
+    }
+
     char* source = ReadFileData(argv[1]);
     TokenList tokens = Scan(source);
     free(source);
     Rom output_code = { 0 };
-    GenerateCode(&tokens, &output_code);
+    SymbolMap* symbols = calloc(1, sizeof(SymbolMap));
+    ASSERT(symbols != NULL, "Could not allocate memory for symbol map");
+    GenerateCode(&tokens, &output_code, symbols);
     free(tokens.data);
 
     WriteOutputFile(argv[1], &output_code);
     WriteHexDumpFile(argv[1], &output_code);
+    WriteSymbolFile(argv[1], symbols);
+    free(symbols);
 
     return 0;
 }
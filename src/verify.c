@@ -0,0 +1,291 @@
+#include "../include/verify.h"
+#include "../include/compiler.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEPTH_UNKNOWN INT32_MIN
+#define DEPTH_FLOOR (-ROM_SIZE_MAX) // Lowest depth tracked. Only words that recurse while consuming the stack get this low
+
+// How much each instruction grows or shrinks the data stack
+// CALL depends on the word being called and is handled separately
+static const int8_t stack_effects[] = {
+    [NOP]    =  0, [HALT]   =  0,
+    [PUSH]   =  1, [DUP]    =  1,
+    [OVER]   =  1, [POP]    = -1,
+    [NIP]    = -1, [SWAP]   =  0,
+    [ROT]    =  0, [LOAD]   =  0,
+    [STORE]  = -2, [LOADb]  =  0,
+    [STOREb] = -2, [ADD]    = -1,
+    [SUB]    = -1, [ADDc]   = -1,
+    [SUBc]   = -1, [SHL]    = -1,
+    [SHR]    = -1, [bNAND]  = -1,
+    [NAND]   = -1, [EQUAL]  = -1,
+    [MORE]   = -1, [LESS]   = -1,
+    [JUMP]   =  0, [JIF0]   = -1,
+    [JIFN0]  = -1,
+    [CALL]   =  0, [RET]    =  0,
+};
+
+// How many items each instruction needs on the data stack before it runs
+static const uint8_t stack_inputs[] = {
+    [NOP]    = 0, [HALT]   = 0,
+    [PUSH]   = 0, [DUP]    = 1,
+    [OVER]   = 2, [POP]    = 1,
+    [NIP]    = 2, [SWAP]   = 2,
+    [ROT]    = 3, [LOAD]   = 1,
+    [STORE]  = 2, [LOADb]  = 1,
+    [STOREb] = 2, [ADD]    = 2,
+    [SUB]    = 2, [ADDc]   = 2,
+    [SUBc]   = 2, [SHL]    = 2,
+    [SHR]    = 2, [bNAND]  = 2,
+    [NAND]   = 2, [EQUAL]  = 2,
+    [MORE]   = 2, [LESS]   = 2,
+    [JUMP]   = 0, [JIF0]   = 1,
+    [JIFN0]  = 1,
+    [CALL]   = 0, [RET]    = 0,
+};
+
+typedef struct {
+    bool boundary[ROM_SIZE_MAX];
+    bool is_word[ROM_SIZE_MAX];
+    int32_t word_effect[ROM_SIZE_MAX]; // Indexed by the address the word starts at
+    int32_t word_min_depth[ROM_SIZE_MAX]; // Lowest depth the word reaches relative to its entry, also indexed by address
+    bool word_halts[ROM_SIZE_MAX]; // Whether some path through the word reaches HALT, also indexed by address
+    uint16_t words[ROM_SIZE_MAX]; // Start address of every word
+    int word_count;
+    int32_t depth[ROM_SIZE_MAX];
+    uint16_t worklist[ROM_SIZE_MAX]; // Every address visited by the current analysis, in the order they were found
+    uint16_t worklist_length;
+} VerifyState;
+
+static inline bool HasOperand(uint8_t op) {
+    return op == PUSH || op == JUMP || op == JIF0 || op == JIFN0 || op == CALL;
+}
+
+static inline bool IsBranch(uint8_t op) {
+    return op == JUMP || op == JIF0 || op == JIFN0 || op == CALL;
+}
+
+static inline uint16_t ReadWord(const Rom* rom, uint16_t address) {
+    return (rom->data[address] << 8) | rom->data[address+1];
+}
+
+static void MergeDepth(const Rom* rom, uint16_t from, uint32_t address, int32_t depth, VerifyState* state, bool report, bool* has_errored) {
+    if (address >= rom->size) {
+        if (report) {
+            printf("[ERROR]: Execution runs past the end of the program after address 0x%04x\n", from);
+            *has_errored = true;
+        }
+        return;
+    }
+
+    if (state->depth[address] == DEPTH_UNKNOWN) {
+        state->depth[address] = depth;
+        state->worklist[state->worklist_length++] = address;
+        return;
+    }
+
+    if (state->depth[address] != depth && report) {
+        printf("[ERROR]: Inconsistent stack depth at address 0x%04x (%d coming from 0x%04x, %d elsewhere)\n", address, depth, from, state->depth[address]);
+        *has_errored = true;
+    }
+}
+
+// Walks every path from 'entry' and returns the stack effect of the word, or DEPTH_UNKNOWN if it never returns
+// Calls to words whose effect isn't known yet are treated as never returning
+// 'min_depth' gets the lowest depth any instruction in the word dips to, relative to the entry
+// 'halts' is set if some path reaches HALT, either in the word itself or in a word it calls
+// The program entry at address 0 starts with empty stacks, so 'is_program_entry' also rejects underflows and returns
+static int32_t AnalyseWord(const Rom* rom, uint16_t entry, VerifyState* state, bool is_program_entry, int32_t* min_depth, bool* halts, bool report, bool* has_errored) {
+    // Only the addresses the previous analysis visited need resetting
+    for (int i=0; i<state->worklist_length; i++) {
+        state->depth[state->worklist[i]] = DEPTH_UNKNOWN;
+    }
+    state->worklist_length = 0;
+
+    int32_t effect = DEPTH_UNKNOWN;
+    *min_depth = 0;
+    *halts = false;
+    MergeDepth(rom, entry, entry, 0, state, report, has_errored);
+
+    for (int item=0; item<state->worklist_length; item++) {
+        uint16_t address = state->worklist[item];
+        int32_t depth = state->depth[address];
+        uint8_t op = rom->data[address];
+        uint32_t next = address + (HasOperand(op) ? 3 : 1);
+
+        int32_t lowest = depth - stack_inputs[op];
+        if (op == CALL) {
+            uint16_t callee = ReadWord(rom, address+1);
+            lowest = depth + state->word_min_depth[callee];
+            // Calling itself below the entry depth lowers the minimum again on every pass, so skip to the floor
+            if (callee == entry && depth < 0) lowest = DEPTH_FLOOR;
+        }
+        if (lowest < *min_depth) *min_depth = lowest < DEPTH_FLOOR ? DEPTH_FLOOR : lowest;
+
+        // Only the instruction that first drops below zero gets reported
+        if (is_program_entry && report && lowest < 0 && depth >= 0) {
+            if (op == CALL) {
+                printf("[ERROR]: CALL at address 0x%04x underflows the stack inside the word at 0x%04x\n", address, ReadWord(rom, address+1));
+            } else {
+                printf("[ERROR]: Stack underflow at address 0x%04x\n", address);
+            }
+            *has_errored = true;
+        }
+
+        switch (op) {
+            case HALT:
+                *halts = true;
+                break;
+
+            case RET:
+                if (is_program_entry && report) {
+                    printf("[ERROR]: RET at address 0x%04x is reached with an empty return stack\n", address);
+                    *has_errored = true;
+                }
+                if (effect == DEPTH_UNKNOWN) {
+                    effect = depth;
+                } else if (effect != depth && report) {
+                    printf("[ERROR]: Word at address 0x%04x returns with inconsistent stack depths (%d at 0x%04x, %d elsewhere)\n", entry, depth, address, effect);
+                    *has_errored = true;
+                }
+                break;
+
+            case JUMP:
+                MergeDepth(rom, address, ReadWord(rom, address+1), depth, state, report, has_errored);
+                break;
+
+            case JIF0:
+            case JIFN0:
+                MergeDepth(rom, address, ReadWord(rom, address+1), depth-1, state, report, has_errored);
+                MergeDepth(rom, address, next, depth-1, state, report, has_errored);
+                break;
+
+            case CALL: {
+                uint16_t callee = ReadWord(rom, address+1);
+                if (state->word_halts[callee]) *halts = true;
+
+                if (state->word_effect[callee] != DEPTH_UNKNOWN) {
+                    MergeDepth(rom, address, next, depth+state->word_effect[callee], state, report, has_errored);
+                } else if (!state->word_halts[callee] && is_program_entry && report) {
+                    printf("[ERROR]: CALL at address 0x%04x calls word at 0x%04x which never returns or halts\n", address, callee);
+                    *has_errored = true;
+                }
+                break;
+            }
+
+            default:
+                MergeDepth(rom, address, next, depth+stack_effects[op], state, report, has_errored);
+                break;
+        }
+    }
+
+    return effect;
+}
+
+static bool CheckRom(const Rom* rom, VerifyState* state) {
+    if (rom->size > ROM_SIZE_MAX) {
+        printf("[ERROR]: Program size 0x%04x exceeds rom size limit\n", rom->size);
+        return false;
+    }
+
+    bool has_errored = false;
+
+    // Find instruction boundaries and unknown opcodes
+    for (uint32_t address=0; address<rom->size;) {
+        uint8_t op = rom->data[address];
+        if (op > RET) {
+            printf("[ERROR]: Unknown opcode 0x%02x at address 0x%04x\n", op, address);
+            return false;
+        }
+        if (HasOperand(op) && address+3 > rom->size) {
+            printf("[ERROR]: Instruction at address 0x%04x is cut off by the end of the program\n", address);
+            return false;
+        }
+
+        state->boundary[address] = true;
+        address += HasOperand(op) ? 3 : 1;
+    }
+
+    // Every branch has to land on one of those boundaries
+    for (uint32_t address=0; address<rom->size; address += HasOperand(rom->data[address]) ? 3 : 1) {
+        uint8_t op = rom->data[address];
+        if (!IsBranch(op)) continue;
+
+        uint16_t target = ReadWord(rom, address+1);
+        if (target >= rom->size || !state->boundary[target]) {
+            printf("[ERROR]: Branch at address 0x%04x targets 0x%04x which is not the start of an instruction\n", address, target);
+            has_errored = true;
+            continue;
+        }
+        if (op == CALL && !state->is_word[target]) {
+            state->is_word[target] = true;
+            state->words[state->word_count++] = target;
+        }
+    }
+    if (has_errored) return false;
+
+    // Without a 'main' word the entry calls itself forever
+    if (rom->data[0] == CALL && ReadWord(rom, 1) == 0) {
+        printf("[ERROR]: Program entry calls address 0x0000, the program has no 'main' word\n");
+        return false;
+    }
+
+    // Figure out the stack effect and lowest depth of every word. Each pass can improve words calling the ones
+    // updated in the previous pass. Words whose effect is still unknown afterwards never return, they can only halt
+    for (int i=0; i<rom->size; i++) {
+        state->word_effect[i] = DEPTH_UNKNOWN;
+        state->depth[i] = DEPTH_UNKNOWN;
+    }
+    int passes_since_new_effect = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        passes_since_new_effect++;
+        for (int w=0; w<state->word_count; w++) {
+            uint16_t i = state->words[w];
+            int32_t min_depth;
+            bool halts;
+            int32_t effect = AnalyseWord(rom, i, state, false, &min_depth, &halts, false, &has_errored);
+            if (state->word_effect[i] == DEPTH_UNKNOWN && effect != DEPTH_UNKNOWN) {
+                state->word_effect[i] = effect;
+                passes_since_new_effect = 0;
+                changed = true;
+            }
+            if (halts && !state->word_halts[i]) {
+                state->word_halts[i] = true;
+                passes_since_new_effect = 0;
+                changed = true;
+            }
+            if (min_depth < state->word_min_depth[i]) {
+                // Once the effects settle, depths still dropping after every word had a chance to update
+                // means mutual recursion that eats the stack, so skip straight to the floor
+                state->word_min_depth[i] = passes_since_new_effect > state->word_count+1 ? DEPTH_FLOOR : min_depth;
+                changed = true;
+            }
+        }
+    }
+
+    // Now that every call has a known effect, check the stack depth is consistent everywhere
+    int32_t min_depth;
+    bool halts;
+    AnalyseWord(rom, 0, state, true, &min_depth, &halts, true, &has_errored);
+    for (int w=0; w<state->word_count; w++) {
+        AnalyseWord(rom, state->words[w], state, false, &min_depth, &halts, true, &has_errored);
+    }
+
+    return !has_errored;
+}
+
+bool VerifyRom(const Rom* rom) {
+    // The state is too big to put on the stack of a VM worker thread
+    VerifyState* state = calloc(1, sizeof(VerifyState));
+    ASSERT(state != NULL, "Could not allocate memory for rom verification");
+
+    bool is_valid = CheckRom(rom, state);
+    free(state);
+
+    return is_valid;
+}